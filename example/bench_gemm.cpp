@@ -0,0 +1,86 @@
+#include <iostream>
+#include <chrono>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Gemm.hpp"
+#include "config.hpp"
+
+// benchmark of gemm() against BLAS, per shape class:
+//   tiny  : the layers of the iris net, W * x, W.t() * d and d * y.t()
+//   skinny: narrow layers on a large batch
+//   square: small and large square shapes around the crossover
+
+typedef struct {
+    const char* shape;
+    size_t m, n, k;
+    bool transA, transB;
+} Case;
+
+static const Case cases[] = {
+    {"tiny",   5,    91,   4,    false, false},
+    {"tiny",   3,    91,   5,    false, false},
+    {"tiny",   5,    91,   3,    true,  false},
+    {"tiny",   5,    4,    91,   false, true },
+    {"skinny", 8,    1024, 64,   false, false},
+    {"skinny", 4,    4096, 16,   false, false},
+    {"skinny", 64,   8,    1024, false, true },
+    {"square", 16,   16,   16,   false, false},
+    {"square", 32,   32,   32,   false, false},
+    {"square", 64,   64,   64,   false, false},
+    {"square", 256,  256,  256,  false, false},
+};
+
+// seconds per call
+template<class F>
+static double timeit(F f, size_t n) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        f();
+    }
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return dt.count() / n;
+}
+
+int main(int argc, char *argv[])
+{
+    GemmDispatch &dispatch = GemmDispatch::instance();
+    // load the thresholds of this host, or calibrate them
+    dispatch.small(1, 1, 1);
+    fprintf(stdout, "crossover: square %lu, skinny %lu (m * n * k)\n\n",
+            (unsigned long)dispatch.square.load(), (unsigned long)dispatch.skinny.load());
+
+    fprintf(stdout, "%-8s %16s %8s %12s %12s %12s %8s\n", "shape", "m x n x k", "op", "blas(us)", "kernel(us)", "gemm(us)", "route");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        const Case &t = cases[c];
+
+        mat_t A = t.transA ? arma::randu<mat_t>(t.k, t.m) : arma::randu<mat_t>(t.m, t.k);
+        mat_t B = t.transB ? arma::randu<mat_t>(t.n, t.k) : arma::randu<mat_t>(t.k, t.n);
+        mat_t C;
+
+        mat_t At = t.transA ? mat_t(A.t()) : A;
+        mat_t Bt = t.transB ? mat_t(B.t()) : B;
+        mat_t Ck(t.m, t.n);
+
+        size_t reps = 1 + 50000000 / (t.m * t.n * t.k);
+
+        double tb = timeit([&] {
+            if (t.transA) C = A.t() * B;
+            else if (t.transB) C = A * B.t();
+            else C = A * B;
+        }, reps);
+        double tk = timeit([&] { gemm_kernel(At.memptr(), t.m, Bt.memptr(), t.k, Ck.memptr(), t.m, t.m, t.n, t.k); }, reps);
+        double tg = timeit([&] { gemm(A, B, C, t.transA, t.transB); }, reps);
+
+        char dims[32];
+        snprintf(dims, sizeof(dims), "%lux%lux%lu", (unsigned long)t.m, (unsigned long)t.n, (unsigned long)t.k);
+
+        fprintf(stdout, "%-8s %16s %8s %12.3f %12.3f %12.3f %8s\n", t.shape, dims,
+                t.transA ? "A'B" : (t.transB ? "AB'" : "AB"), tb * 1e6, tk * 1e6, tg * 1e6,
+                dispatch.small(t.m, t.n, t.k) ? "kernel" : "blas");
+    }
+
+    return 0;
+}
@@ -20,14 +20,9 @@ using namespace std;
 // utility function: find the index of max value in each column
 static std::vector<int> argmax(const mat_t& x)
 {
-    arma::uvec idx;
-    std::vector<int> index(x.n_cols);
-    for (size_t i = 0; i < x.n_cols; ++i) {
-        idx = arma::sort_index(x.col(i), "descend");
-        index[i] = idx(0);
-    }
-
-    return index;
+    // a single linear pass over each column instead of sorting it
+    arma::urowvec idx = arma::index_max(x, 0);
+    return std::vector<int>(idx.begin(), idx.end());
 }
 
 // utility function: classification performance evaluation
@@ -62,20 +57,32 @@ int main(int argc, char *argv[])
     trainopts.lr      = 1e-1;
 
     const char *iris_dat = "data/iris.csv";
+    const char *resume_ckpt = NULL;
     int shuffle = 1;
+    unsigned int seed = (unsigned int)time(NULL);
+    int seeded = 0;
+    int early_stop = 0;
+    int autotune = 0;
 
     // parse options
     char ch;
-    while ((ch = getopt(argc, argv, "hvsk:r:f:")) != EOF) {
+    while ((ch = getopt(argc, argv, "hvsS:k:r:f:c:R:p:j:ta")) != EOF) {
         switch (ch) {
         case 'h':
             fprintf(stdout, "iris_example [options], where options are: \n");
             fprintf(stdout, "  -h\t\t print this help message\n");
             fprintf(stdout, "  -v\t\t print version message\n");
             fprintf(stdout, "  -s\t\t shuffle data before training (default: true)\n");
+            fprintf(stdout, "  -S\t\t seed of the shuffle (default: current time)\n");
             fprintf(stdout, "  -k\t\t maximum number of iteration (default: 25)\n");
             fprintf(stdout, "  -r\t\t learning rate (default: 1e-2)\n");
             fprintf(stdout, "  -f\t\t path to iris data file (default: ./data/iris.csv)\n");
+            fprintf(stdout, "  -c\t\t checkpoint every n iterations (default: 0, disabled)\n");
+            fprintf(stdout, "  -R\t\t resume training from a checkpoint file, needs -S of the original run\n");
+            fprintf(stdout, "  -p\t\t early stopping patience, validated on a split of the held-out data (default: 0, disabled)\n");
+            fprintf(stdout, "  -j\t\t pipelined training on n threads (default: 0, sequential)\n");
+            fprintf(stdout, "  -t\t\t with -j, feed forward through weights at most one step stale (default: false)\n");
+            fprintf(stdout, "  -a\t\t autotune batch size and threads unless set, cached per host in ./, not with -R (default: false)\n");
             exit(0);
 
             break;
@@ -87,6 +94,10 @@ int main(int argc, char *argv[])
         case 's':
             shuffle = 1;
             break;
+        case 'S':
+            seed   = (unsigned int)strtoul(optarg, NULL, 10);
+            seeded = 1;
+            break;
         case 'k':
             trainopts.maxIter = atoi(optarg);
             break;
@@ -96,8 +107,28 @@ int main(int argc, char *argv[])
         case 'f':
             iris_dat = optarg;
             break;
+        case 'c':
+            trainopts.ckptInterval = atoi(optarg);
+            trainopts.ckptPrefix   = "nn_mlp4iris";
+            break;
+        case 'R':
+            resume_ckpt = optarg;
+            break;
+        case 'p':
+            trainopts.patience = atoi(optarg);
+            early_stop = trainopts.patience > 0;
+            break;
+        case 'j':
+            trainopts.nthreads = atoi(optarg);
+            break;
+        case 't':
+            trainopts.staleness = true;
+            break;
+        case 'a':
+            autotune = 1;
+            break;
         case '?':
-            if (optopt == 'k' || optopt == 'r' || optopt == 'f') {
+            if (optopt == 'S' || optopt == 'k' || optopt == 'r' || optopt == 'f' || optopt == 'c' || optopt == 'R' || optopt == 'p' || optopt == 'j') {
                 fprintf(stderr, "option %c has an argument\n", optopt);
                 exit(-1);
             } else if (isprint(optopt)) {
@@ -129,8 +160,15 @@ int main(int argc, char *argv[])
 
     mat_t feature, label;
 
+    // a resumed run must see the same train/test split as the original one
+    if (resume_ckpt && shuffle && !seeded) {
+        fprintf(stderr, "resuming needs the shuffle seed of the original run (-S), exit ...\n");
+        exit(-1);
+    }
+
     if (shuffle) {
-        srand(time(NULL));
+        fprintf(stdout, "shuffling data with seed %u\n", seed);
+        srand(seed);
         std::random_shuffle(result.begin(), result.end());
     }
 
@@ -144,6 +182,21 @@ int main(int argc, char *argv[])
     mat_t x = feature.rows(0, k - 1).t();
     mat_t y = label.rows(0, k - 1).t();
 
+    // held-out data, the first half is the validation set when early
+    // stopping is enabled, so that the test set is not used to pick the weights
+    int v = early_stop ? k + (nsamples - k) / 2 : k;
+
+    mat_t xval, yval;
+    if (early_stop) {
+        xval = feature.rows(k, v - 1).t();
+        yval = label.rows(k, v - 1).t();
+        trainopts.xval = &xval;
+        trainopts.yval = &yval;
+    }
+
+    mat_t xtest = feature.rows(v, nsamples - 1).t();
+    mat_t ytest = label.rows(v, nsamples - 1).t();
+
     // create a multi-layer perceptron
     MultiLayerPerceptron* nnet = new MultiLayerPerceptron("mlp", 4, 3);
 
@@ -154,8 +207,26 @@ int main(int argc, char *argv[])
     fprintf(stdout, "building MultiLayerPerceptron model ...\n");
     nnet->build(arch);
 
+    // the configuration cached on this host by an earlier run is used, the
+    // trials only run on a miss. A resumed run takes the batch size and the
+    // staleness of the original one from the checkpoint instead
+    if (autotune && !resume_ckpt) {
+        trainopts.tuneDir = ".";
+        if (!nnet->load_tuning(&trainopts)) {
+            fprintf(stdout, "autotuning MultiLayerPerceptron model ...\n");
+            nnet->autotune(x, y, &trainopts);
+        }
+    }
+
     fprintf(stdout, "training MultiLayerPerceptron model with options: [maxIter=%d, learning rate=%g]\n", trainopts.maxIter, trainopts.lr);
-    nnet->train(x, y, &trainopts);
+    if (resume_ckpt) {
+        if (!nnet->resume(resume_ckpt, x, y, &trainopts)) {
+            fprintf(stderr, "resuming from %s failed, exit ...\n", resume_ckpt);
+            exit(-1);
+        }
+    } else {
+        nnet->train(x, y, &trainopts);
+    }
 
     fprintf(stdout, "testing MultiLayerPerceptron model ...\n");
     fprintf(stdout, "performance on train set\n");
@@ -163,12 +234,9 @@ int main(int argc, char *argv[])
     evaluate(scores, y);
 
     fprintf(stdout, "performance on test set\n");
-    x = feature.rows(k, nsamples - 1).t();
-    y = label.rows(k, nsamples - 1).t();
-
-    scores = nnet->ff(x);
+    scores = nnet->ff(xtest);
     //scores.save("scores.dat", raw_ascii);
-    evaluate(scores, y);
+    evaluate(scores, ytest);
 
     // save model to .dot or .json file
     fprintf(stdout, "saving model to nn_mlp4iris.dot ...\n");
@@ -0,0 +1,153 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+#include <getopt.h>
+
+#include "Iris.cpp"
+#include "NeuralNetwork.hpp"
+#include "DataLoader.hpp"
+#include "config.hpp"
+
+using namespace std;
+
+// online learning while serving: a reader thread calls predict() in a loop
+// on the last published weights, while the main thread streams the samples
+// one at a time through partial_fit(), and the latency of each update is
+// measured
+int main(int argc, char *argv[])
+{
+    const char *iris_dat = "data/iris.csv";
+    size_t npasses = 20;
+    double lr      = 1e-1;
+
+    // parse options
+    char ch;
+    while ((ch = getopt(argc, argv, "hn:r:f:")) != EOF) {
+        switch (ch) {
+        case 'h':
+            fprintf(stdout, "online_serve [options], where options are: \n");
+            fprintf(stdout, "  -h\t\t print this help message\n");
+            fprintf(stdout, "  -n\t\t number of passes over the samples (default: 20)\n");
+            fprintf(stdout, "  -r\t\t learning rate (default: 1e-1)\n");
+            fprintf(stdout, "  -f\t\t path to iris data file (default: ./data/iris.csv)\n");
+            exit(0);
+
+            break;
+        case 'n':
+            npasses = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            lr       = atof(optarg);
+            break;
+        case 'f':
+            iris_dat = optarg;
+            break;
+        case '?':
+            if (optopt == 'n' || optopt == 'r' || optopt == 'f') {
+                fprintf(stderr, "option %c has an argument\n", optopt);
+            } else if (isprint(optopt)) {
+                fprintf(stderr, "invalid option %c\n", optopt);
+            } else {
+                fprintf(stderr, "invalid option \\0x%x\n", optopt);
+            }
+            exit(-1);
+
+            break;
+        default:
+            break;
+        }
+    }
+
+    fprintf(stdout, "loading iris data from %s ...\n", iris_dat);
+    CsvDataLoader<Iris> *loader = new CsvDataLoader<Iris>("iris_loader", 0);
+
+    vector<Iris> result;
+    if (false == loader->load(iris_dat, result)) {
+        fprintf(stderr, "loading iris data failed, exit ...\n");
+        exit(-1);
+    }
+
+    mat_t feature, label;
+    Iris::load_feature_label(result, feature, label);
+
+    mat_t x = feature.t();
+    mat_t y = label.t();
+
+    MultiLayerPerceptron* nnet = new MultiLayerPerceptron("mlp", 4, 3);
+
+    std::vector<size_t> arch;
+    arch.push_back(5);
+    nnet->build(arch);
+
+    // reader: predict() on the whole set until the trainer is done, every
+    // output must be a valid activation of the published weights
+    std::atomic<bool> done(false);
+    size_t npredicts = 0, ninvalid = 0;
+
+    std::thread reader([&] {
+        mat_t out;
+        while (!done.load(std::memory_order_acquire)) {
+            nnet->predict(x, out);
+            if (out.n_rows != 3 || out.n_cols != x.n_cols || !out.is_finite() \
+                    || out.min() < 0 || out.max() > 1) {
+                ninvalid++;
+            }
+            npredicts++;
+        }
+    });
+
+    // trainer: one partial_fit() per sample, the input is an alias of the
+    // column so that nothing is copied on the hot path
+    std::vector<double> latency;
+    latency.reserve(npasses * x.n_cols);
+
+    for (size_t p = 0; p < npasses; ++p) {
+        for (size_t i = 0; i < x.n_cols; ++i) {
+            const mat_t xi(x.colptr(i), x.n_rows, 1, false, true);
+            const mat_t yi(y.colptr(i), y.n_rows, 1, false, true);
+
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            nnet->partial_fit(xi, yi, lr);
+            std::chrono::duration<double, std::micro> dt = std::chrono::steady_clock::now() - t0;
+
+            latency.push_back(dt.count());
+        }
+    }
+
+    done.store(true, std::memory_order_release);
+    reader.join();
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    assert(n > 0);
+
+    double total = 0;
+    size_t nfast = 0;
+    for (size_t i = 0; i < n; ++i) {
+        total += latency[i];
+        if (latency[i] < 1000) nfast++;
+    }
+
+    fprintf(stdout, "updates: %lu, predictions served meanwhile: %lu, invalid: %lu\n",
+            (unsigned long)n, (unsigned long)npredicts, (unsigned long)ninvalid);
+    fprintf(stdout, "update latency (us): mean %.2f, p50 %.2f, p99 %.2f, max %.2f\n",
+            total / n, latency[n / 2], latency[(n * 99) / 100], latency[n - 1]);
+    fprintf(stdout, "updates under 1 ms: %.3f%%\n", 100.0 * nfast / n);
+
+    mat_t scores;
+    nnet->predict(x, scores);
+    arma::urowvec decision = arma::index_max(scores, 0);
+    arma::urowvec truth    = arma::index_max(y, 0);
+    fprintf(stdout, "accuracy after online training: %.3f%%\n",
+            100.0 * arma::accu(decision == truth) / x.n_cols);
+
+    return ninvalid == 0 ? 0 : -1;
+}
@@ -0,0 +1,150 @@
+#ifndef __Autotune_H__
+#define __Autotune_H__
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// #################
+//    Interface
+// #################
+
+// best configuration found by MultiLayerPerceptron::autotune()
+typedef struct {
+    // TrainOpts::batchSize, TrainOpts::nthreads and the number of BLAS threads
+    size_t batchSize;
+    size_t nthreads;
+    size_t blasThreads;
+    // samples/sec of the train step
+    double trainRate;
+    // bytes held by the training workspaces once sized for the batch
+    size_t workspaceBytes;
+
+    // columns per chunk of predict() (0: all at once), the number of BLAS
+    // threads for inference, and the samples/sec of the inference
+    size_t inferBatch;
+    size_t inferBlasThreads;
+    double inferRate;
+} TuneConfig;
+
+// Per-host cache of the autotune results, one file per host in a directory:
+//   <dir>/tinynn_autotune.<hostname>
+// with one line per model, keyed by the layer sizes of the model:
+//   <key> batchSize nthreads blasThreads trainRate workspaceBytes
+//         inferBatch inferBlasThreads inferRate
+class TuneCache {
+public:
+    TuneCache(const char* dir = ".");
+
+    bool lookup(const std::string& key, TuneConfig& config) const;
+    bool store(const std::string& key, const TuneConfig& config) const;
+
+    // candidate values of the trials on this host
+    static std::vector<size_t> batch_sizes(size_t nsamples);
+    static std::vector<size_t> thread_counts();
+
+    static std::string hostname();
+
+protected:
+    std::string filename;
+};
+
+// ################
+//  Implementation
+// ################
+
+TuneCache::TuneCache(const char* dir) {
+    this->filename = std::string(dir) + "/tinynn_autotune." + TuneCache::hostname();
+}
+
+bool TuneCache::lookup(const std::string& key, TuneConfig& config) const {
+    std::ifstream ifs(this->filename.c_str());
+    if (!ifs) {
+        return false;
+    }
+
+    // the last entry of a key wins
+    bool found = false;
+    std::string line, k;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        TuneConfig c;
+        if (iss >> k >> c.batchSize >> c.nthreads >> c.blasThreads >> c.trainRate >> c.workspaceBytes
+                >> c.inferBatch >> c.inferBlasThreads >> c.inferRate && k == key) {
+            config = c;
+            found  = true;
+        }
+    }
+
+    return found;
+}
+
+bool TuneCache::store(const std::string& key, const TuneConfig& config) const {
+    FILE *fp = fopen(this->filename.c_str(), "a");
+    if (NULL == fp) {
+        std::cerr << "can not open autotune cache file " << this->filename << std::endl;
+        return false;
+    }
+
+    fprintf(fp, "%s %lu %lu %lu %g %lu %lu %lu %g\n", key.c_str(),
+            (unsigned long)config.batchSize, (unsigned long)config.nthreads, (unsigned long)config.blasThreads,
+            config.trainRate, (unsigned long)config.workspaceBytes,
+            (unsigned long)config.inferBatch, (unsigned long)config.inferBlasThreads, config.inferRate);
+    fclose(fp);
+
+    return true;
+}
+
+std::vector<size_t> TuneCache::batch_sizes(size_t nsamples) {
+    // powers of 2 from 16, and the full batch (0)
+    std::vector<size_t> sizes;
+    for (size_t b = 16; b < nsamples; b *= 2) {
+        sizes.push_back(b);
+    }
+    sizes.push_back(0);
+
+    return sizes;
+}
+
+std::vector<size_t> TuneCache::thread_counts() {
+    // 0 (sequential), then powers of 2 up to the number of cores
+    size_t ncores = std::thread::hardware_concurrency();
+    if (ncores == 0) {
+        ncores = 1;
+    }
+
+    std::vector<size_t> counts(1, 0);
+    for (size_t t = 1; t <= ncores; t *= 2) {
+        counts.push_back(t);
+    }
+
+    return counts;
+}
+
+std::string TuneCache::hostname() {
+    char name[256] = "localhost";
+#ifdef _WIN32
+    const char *env = getenv("COMPUTERNAME");
+    if (env) {
+        snprintf(name, sizeof(name), "%s", env);
+    }
+#else
+    if (gethostname(name, sizeof(name)) != 0) {
+        snprintf(name, sizeof(name), "localhost");
+    }
+    name[sizeof(name) - 1] = '\0';
+#endif
+
+    return std::string(name);
+}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef __Checkpoint_H__
+#define __Checkpoint_H__
+
+#include <iostream>
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Snapshot.hpp"
+#include "config.hpp"
+
+// #################
+//    Interface
+// #################
+
+// Binary checkpoint file:
+//   magic "TNNC", version, iteration, number of layers,
+//   then for each layer: (rows, cols) of W, W, (rows, cols) of b, b,
+//   then the early stopping state: stopped, nbad, bestIter, number of
+//   layers of the best weights, bestLoss, and the best W, b of each layer,
+//   then the square and skinny thresholds of the gemm dispatch,
+//   then the batch size and staleness of the training options
+// The raw doubles are written as is, so that training resumed from a
+// checkpoint continues bit-for-bit.
+bool write_checkpoint(const char* filename, const Snapshot& snapshot);
+bool read_checkpoint(const char* filename, Snapshot& snapshot);
+
+// Write checkpoints in a background thread, keep the last N files on disk.
+// The files left by earlier runs with the same prefix count as well, so
+// that the limit holds across preempted and resumed jobs.
+class CheckpointWriter: public SnapshotWorker {
+public:
+    CheckpointWriter(const char* prefix = "nn_mlp", size_t keep = 3);
+    ~CheckpointWriter();
+
+protected:
+    void process(const Snapshot& snapshot);
+
+    // collect the existing <prefix>.<iteration>.ckpt files, the oldest first
+    void scan();
+
+    std::string prefix;
+    size_t keep;
+
+    // checkpoint files on disk, the oldest first
+    std::deque<std::string> files;
+};
+
+// ################
+//  Implementation
+// ################
+
+static const char   CKPT_MAGIC[4] = {'T', 'N', 'N', 'C'};
+static const size_t CKPT_VERSION  = 4;
+
+static bool write_matrix(FILE* fp, const mat_t& m) {
+    size_t shape[2] = {m.n_rows, m.n_cols};
+    if (fwrite(shape, sizeof(size_t), 2, fp) != 2) return false;
+    return fwrite(m.memptr(), sizeof(double), m.n_elem, fp) == m.n_elem;
+}
+
+static bool read_matrix(FILE* fp, mat_t& m) {
+    size_t shape[2];
+    if (fread(shape, sizeof(size_t), 2, fp) != 2) return false;
+    m.set_size(shape[0], shape[1]);
+    return fread(m.memptr(), sizeof(double), m.n_elem, fp) == m.n_elem;
+}
+
+bool write_checkpoint(const char* filename, const Snapshot& snapshot) {
+    // write to a temporary file first, so that a preempted job never
+    // leaves a truncated checkpoint behind
+    std::string tmpname = std::string(filename) + ".tmp";
+
+    FILE *fp = fopen(tmpname.c_str(), "wb");
+    if (NULL == fp) {
+        std::cerr << "can not open checkpoint file " << tmpname << std::endl;
+        return false;
+    }
+
+    size_t header[3] = {CKPT_VERSION, snapshot.iter, snapshot.W.size()};
+    bool ok = fwrite(CKPT_MAGIC, 1, 4, fp) == 4 && fwrite(header, sizeof(size_t), 3, fp) == 3;
+
+    for (size_t i = 0; ok && i < snapshot.W.size(); ++i) {
+        ok = write_matrix(fp, snapshot.W[i]) && write_matrix(fp, snapshot.b[i]);
+    }
+
+    const EarlyStopState &es = snapshot.es;
+    size_t state[4] = {es.stopped ? 1u : 0u, es.nbad, es.bestIter, es.W.size()};
+    ok = ok && fwrite(state, sizeof(size_t), 4, fp) == 4 && fwrite(&es.bestLoss, sizeof(double), 1, fp) == 1;
+
+    for (size_t i = 0; ok && i < es.W.size(); ++i) {
+        ok = write_matrix(fp, es.W[i]) && write_matrix(fp, es.b[i]);
+    }
+
+    size_t gemm[2] = {snapshot.gemmSquare, snapshot.gemmSkinny};
+    ok = ok && fwrite(gemm, sizeof(size_t), 2, fp) == 2;
+
+    size_t opts[2] = {snapshot.batchSize, snapshot.staleness ? 1u : 0u};
+    ok = ok && fwrite(opts, sizeof(size_t), 2, fp) == 2;
+
+    // the data must be on disk before the rename makes the file visible
+    ok = ok && fflush(fp) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(fp)) == 0;
+#else
+    ok = ok && fsync(fileno(fp)) == 0;
+#endif
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        std::cerr << "writing checkpoint file " << tmpname << " failed" << std::endl;
+        remove(tmpname.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    // rename does not replace an existing file on Windows, elsewhere it
+    // does so atomically and the old checkpoint stays until then
+    remove(filename);
+#endif
+    return rename(tmpname.c_str(), filename) == 0;
+}
+
+bool read_checkpoint(const char* filename, Snapshot& snapshot) {
+    FILE *fp = fopen(filename, "rb");
+    if (NULL == fp) {
+        std::cerr << "can not locate checkpoint file " << filename << std::endl;
+        return false;
+    }
+
+    char magic[4];
+    size_t header[3];
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, CKPT_MAGIC, 4) == 0 \
+              && fread(header, sizeof(size_t), 3, fp) == 3 && header[0] >= 1 && header[0] <= CKPT_VERSION;
+
+    if (ok) {
+        snapshot.iter = header[1];
+        snapshot.W.resize(header[2]);
+        snapshot.b.resize(header[2]);
+    }
+
+    for (size_t i = 0; ok && i < snapshot.W.size(); ++i) {
+        ok = read_matrix(fp, snapshot.W[i]) && read_matrix(fp, snapshot.b[i]);
+    }
+
+    // version 1 has no early stopping state
+    EarlyStopState &es = snapshot.es;
+    es = EarlyStopState();
+
+    size_t state[4];
+    if (ok && header[0] >= 2) {
+        ok = fread(state, sizeof(size_t), 4, fp) == 4 && fread(&es.bestLoss, sizeof(double), 1, fp) == 1;
+    }
+    if (ok && header[0] >= 2) {
+        es.stopped  = state[0] != 0;
+        es.nbad     = state[1];
+        es.bestIter = state[2];
+        es.W.resize(state[3]);
+        es.b.resize(state[3]);
+    }
+
+    for (size_t i = 0; ok && i < es.W.size(); ++i) {
+        ok = read_matrix(fp, es.W[i]) && read_matrix(fp, es.b[i]);
+    }
+
+    // versions 1 and 2 have no gemm thresholds
+    size_t gemm[2];
+    snapshot.hasGemm = false;
+    if (ok && header[0] >= 3) {
+        ok = fread(gemm, sizeof(size_t), 2, fp) == 2;
+        snapshot.hasGemm    = ok;
+        snapshot.gemmSquare = gemm[0];
+        snapshot.gemmSkinny = gemm[1];
+    }
+
+    // versions 1 to 3 have no training options
+    size_t opts[2];
+    snapshot.hasTrainOpts = false;
+    if (ok && header[0] >= 4) {
+        ok = fread(opts, sizeof(size_t), 2, fp) == 2;
+        snapshot.hasTrainOpts = ok;
+        snapshot.batchSize    = opts[0];
+        snapshot.staleness    = opts[1] != 0;
+    }
+
+    fclose(fp);
+    if (!ok) {
+        std::cerr << "invalid checkpoint file " << filename << std::endl;
+    }
+
+    return ok;
+}
+
+CheckpointWriter::CheckpointWriter(const char* prefix, size_t keep) {
+    this->prefix = std::string(prefix);
+    this->keep   = keep > 0 ? keep : 1;
+
+    this->scan();
+    this->start();
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    // pending checkpoint is written before the worker exits
+    this->stop();
+}
+
+void CheckpointWriter::process(const Snapshot& snapshot) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%06lu.ckpt", (unsigned long)snapshot.iter);
+    std::string filename = this->prefix + suffix;
+
+    if (!write_checkpoint(filename.c_str(), snapshot)) {
+        return;
+    }
+    // a file rewritten after resuming from an older checkpoint is the newest
+    this->files.erase(std::remove(this->files.begin(), this->files.end(), filename), this->files.end());
+    this->files.push_back(filename);
+
+    // keep the last N checkpoints only
+    while (this->files.size() > this->keep) {
+        remove(this->files.front().c_str());
+        this->files.pop_front();
+    }
+}
+
+void CheckpointWriter::scan() {
+    std::string dir  = ".";
+    std::string base = this->prefix;
+
+    size_t slash = this->prefix.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        dir  = this->prefix.substr(0, slash);
+        base = this->prefix.substr(slash + 1);
+    }
+
+    DIR *dp = opendir(dir.empty() ? "/" : dir.c_str());
+    if (NULL == dp) {
+        return;
+    }
+
+    // (iteration, filename) of the files named <base>.<digits>.ckpt
+    std::vector<std::pair<unsigned long, std::string> > found;
+
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL) {
+        std::string name(entry->d_name);
+        if (name.size() <= base.size() + 6 || name.compare(0, base.size() + 1, base + ".") != 0 \
+                || name.compare(name.size() - 5, 5, ".ckpt") != 0) {
+            continue;
+        }
+
+        std::string digits = name.substr(base.size() + 1, name.size() - base.size() - 6);
+        if (digits.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+
+        std::string path = (slash != std::string::npos) ? this->prefix.substr(0, slash + 1) + name : name;
+        found.push_back(std::make_pair(strtoul(digits.c_str(), NULL, 10), path));
+    }
+    closedir(dp);
+
+    std::sort(found.begin(), found.end());
+    for (size_t i = 0; i < found.size(); ++i) {
+        this->files.push_back(found[i].second);
+    }
+}
+
+#endif
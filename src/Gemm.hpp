@@ -0,0 +1,322 @@
+#ifndef __Gemm_H__
+#define __Gemm_H__
+
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "Autotune.hpp"
+#include "config.hpp"
+
+// #################
+//    Interface
+// #################
+
+// C = op(A) * op(B), op(X) is X or X.t().
+//
+// Small and skinny shapes are computed by register-blocked kernels, where
+// the call overhead and packing of BLAS dominate, large shapes are sent to
+// BLAS through armadillo. C must not alias A or B.
+void gemm(const mat_t& A, const mat_t& B, mat_t& C, bool transA = false, bool transB = false);
+
+// set the number of threads of the BLAS library, 0 keeps the current setting
+void set_blas_threads(size_t nthreads);
+
+// raw kernel on contiguous column-major operands: C(m, n) = A(m, k) * B(k, n)
+void gemm_kernel(const double* A, size_t lda, const double* B, size_t ldb, double* C, size_t ldc,
+                 size_t m, size_t n, size_t k);
+
+// Crossover between the kernels and BLAS, in m * n * k.
+//
+// The thresholds are loaded lazily on first use from a per-host file,
+// ./tinynn_gemm.<hostname> or the file named by the environment variable
+// TINYNN_GEMM_CAL, and only calibrated and saved there if it does not
+// exist yet, so that every run on a host routes each shape the same way.
+// The checkpoints record the thresholds, and resume() pins them with
+// set_threshold(), so that resumed training stays bit-for-bit identical
+// on another host as well.
+class GemmDispatch {
+public:
+    static GemmDispatch& instance();
+
+    // load or calibrate the thresholds, once per process, on first use
+    void init();
+
+    // true if the shape is routed to the kernels
+    bool small(size_t m, size_t n, size_t k);
+
+    void set_threshold(size_t square, size_t skinny);
+    void calibrate();
+
+    // shapes with min(m, n) up to SKINNY use the skinny threshold
+    static const size_t SKINNY = 8;
+
+    // may be changed by set_threshold() while other threads dispatch
+    std::atomic<size_t> square;
+    std::atomic<size_t> skinny;
+
+private:
+    GemmDispatch();
+
+    bool load(const char* filename);
+    bool save(const char* filename);
+
+    std::once_flag calibrated;
+};
+
+// ################
+//  Implementation
+// ################
+
+#ifdef USE_OPENBLAS
+extern "C" void openblas_set_num_threads(int nthreads);
+#endif
+
+void set_blas_threads(size_t nthreads) {
+#ifdef USE_OPENBLAS
+    if (nthreads > 0) {
+        openblas_set_num_threads((int)nthreads);
+    }
+#endif
+}
+
+// Micro-kernel for an MR x NR block of C. The accumulators stay in
+// registers, and the innermost loop runs over contiguous rows of A so that
+// it is vectorized by the compiler.
+template<size_t MR, size_t NR>
+static inline void gemm_block(const double* A, size_t lda, const double* B, size_t ldb, double* C, size_t ldc, size_t k) {
+    double acc[NR][MR] = {{0}};
+
+    for (size_t p = 0; p < k; ++p) {
+        const double *a = A + p * lda;
+        for (size_t c = 0; c < NR; ++c) {
+            const double bp = B[c * ldb + p];
+            for (size_t r = 0; r < MR; ++r) {
+                acc[c][r] += a[r] * bp;
+            }
+        }
+    }
+
+    for (size_t c = 0; c < NR; ++c) {
+        for (size_t r = 0; r < MR; ++r) {
+            C[c * ldc + r] = acc[c][r];
+        }
+    }
+}
+
+// fixed height MR, walks over the columns of C
+template<size_t MR>
+static void gemm_rows(const double* A, size_t lda, const double* B, size_t ldb, double* C, size_t ldc, size_t n, size_t k) {
+    // keep MR * NR accumulators within the register file
+    const size_t NR = (MR <= 4) ? 4 : 2;
+
+    size_t j = 0;
+    for (; j + NR <= n; j += NR) {
+        gemm_block<MR, NR>(A, lda, B + j * ldb, ldb, C + j * ldc, ldc, k);
+    }
+    for (; j < n; ++j) {
+        gemm_block<MR, 1>(A, lda, B + j * ldb, ldb, C + j * ldc, ldc, k);
+    }
+}
+
+void gemm_kernel(const double* A, size_t lda, const double* B, size_t ldb, double* C, size_t ldc,
+                 size_t m, size_t n, size_t k) {
+    // common narrow layers (up to 8 units) are computed with the whole
+    // column of C in registers, wider ones in blocks of 4 rows
+    size_t i = 0;
+    if (m > 8) {
+        for (; i + 4 <= m; i += 4) {
+            gemm_rows<4>(A + i, lda, B, ldb, C + i, ldc, n, k);
+        }
+    }
+
+    switch (m - i) {
+    case 8: gemm_rows<8>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 7: gemm_rows<7>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 6: gemm_rows<6>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 5: gemm_rows<5>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 4: gemm_rows<4>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 3: gemm_rows<3>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 2: gemm_rows<2>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    case 1: gemm_rows<1>(A + i, lda, B, ldb, C + i, ldc, n, k); break;
+    default: break;
+    }
+}
+
+static void gemm_blas(const mat_t& A, const mat_t& B, mat_t& C, bool transA, bool transB) {
+    if (transA && transB) {
+        C = A.t() * B.t();
+    } else if (transA) {
+        C = A.t() * B;
+    } else if (transB) {
+        C = A * B.t();
+    } else {
+        C = A * B;
+    }
+}
+
+void gemm(const mat_t& A, const mat_t& B, mat_t& C, bool transA, bool transB) {
+    assert(&C != &A && &C != &B);
+
+    size_t m = transA ? A.n_cols : A.n_rows;
+    size_t k = transA ? A.n_rows : A.n_cols;
+    size_t n = transB ? B.n_rows : B.n_cols;
+    assert(k == (transB ? B.n_cols : B.n_rows));
+
+    if (!GemmDispatch::instance().small(m, n, k)) {
+        gemm_blas(A, B, C, transA, transB);
+        return;
+    }
+
+    // the kernels need op(A) and op(B) contiguous, transposing a small
+    // operand is cheap, the buffers are kept per thread
+    static thread_local mat_t At, Bt;
+    if (transA) {
+        At = A.t();
+    }
+    if (transB) {
+        Bt = B.t();
+    }
+    const mat_t &a = transA ? At : A;
+    const mat_t &b = transB ? Bt : B;
+
+    C.set_size(m, n);
+    gemm_kernel(a.memptr(), m, b.memptr(), k, C.memptr(), m, m, n, k);
+}
+
+GemmDispatch& GemmDispatch::instance() {
+    static GemmDispatch dispatch;
+    return dispatch;
+}
+
+GemmDispatch::GemmDispatch() {
+    this->square = 0;
+    this->skinny = 0;
+}
+
+void GemmDispatch::init() {
+    std::call_once(this->calibrated, [this] {
+        const char *env = getenv("TINYNN_GEMM_CAL");
+        std::string filename = env ? std::string(env) : "tinynn_gemm." + TuneCache::hostname();
+        if (this->load(filename.c_str())) {
+            return;
+        }
+        this->calibrate();
+        this->save(filename.c_str());
+    });
+}
+
+bool GemmDispatch::small(size_t m, size_t n, size_t k) {
+    this->init();
+
+    size_t flops = m * n * k;
+    return flops <= ((m <= SKINNY || n <= SKINNY) ? this->skinny : this->square);
+}
+
+void GemmDispatch::set_threshold(size_t square, size_t skinny) {
+    // skip the calibration on first use
+    std::call_once(this->calibrated, [] {});
+
+    this->square = square;
+    this->skinny = skinny;
+}
+
+// time n calls of f, in seconds per call, best of nruns runs after an
+// untimed warm-up run
+template<class F>
+static double gemm_time(F f, size_t n, size_t nruns = 3) {
+    for (size_t i = 0; i < n; ++i) {
+        f();
+    }
+
+    double best = 0;
+    for (size_t r = 0; r < nruns; ++r) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            f();
+        }
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+        if (r == 0 || dt.count() < best) {
+            best = dt.count();
+        }
+    }
+    return best / n;
+}
+
+void GemmDispatch::calibrate() {
+    // the crossover is the largest size on which the kernels still win,
+    // checked for square shapes and for skinny ones (4 rows). The search
+    // ends after two losses in a row, a single noisy one does not end it,
+    // and the large sizes where BLAS wins anyway are not timed
+    static const size_t sizes[] = {2, 4, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256};
+    static const size_t nsizes  = sizeof(sizes) / sizeof(sizes[0]);
+
+    for (size_t shape = 0; shape < 2; ++shape) {
+        size_t threshold = 0, nlosses = 0;
+
+        for (size_t s = 0; s < nsizes && nlosses < 2; ++s) {
+            size_t m = (shape == 0) ? sizes[s] : 4;
+            size_t n = sizes[s], k = sizes[s];
+
+            mat_t A = arma::randu<mat_t>(m, k);
+            mat_t B = arma::randu<mat_t>(k, n);
+            mat_t C(m, n);
+
+            // enough repetitions for ~1e6 flops per measurement
+            size_t reps = 1 + 1000000 / (m * n * k);
+
+            double tk = gemm_time([&] { gemm_kernel(A.memptr(), m, B.memptr(), k, C.memptr(), m, m, n, k); }, reps);
+            double tb = gemm_time([&] { C = A * B; }, reps);
+
+            if (tk <= tb) {
+                threshold = m * n * k;
+                nlosses   = 0;
+            } else {
+                nlosses++;
+            }
+        }
+
+        if (shape == 0) {
+            this->square = threshold;
+        } else {
+            this->skinny = threshold;
+        }
+    }
+}
+
+bool GemmDispatch::load(const char* filename) {
+    FILE *fp = fopen(filename, "r");
+    if (NULL == fp) {
+        return false;
+    }
+
+    unsigned long square, skinny;
+    bool ok = fscanf(fp, "%lu %lu", &square, &skinny) == 2;
+    fclose(fp);
+
+    if (ok) {
+        this->square = square;
+        this->skinny = skinny;
+    }
+    return ok;
+}
+
+bool GemmDispatch::save(const char* filename) {
+    FILE *fp = fopen(filename, "w");
+    if (NULL == fp) {
+        std::cerr << "can not open gemm calibration file " << filename << std::endl;
+        return false;
+    }
+
+    fprintf(fp, "%lu %lu\n", (unsigned long)this->square.load(), (unsigned long)this->skinny.load());
+    fclose(fp);
+
+    return true;
+}
+
+#endif
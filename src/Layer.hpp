@@ -5,6 +5,7 @@
 #include <string>
 
 #include "Activation.hpp"
+#include "Gemm.hpp"
 #include "config.hpp"
 
 // #################
@@ -30,6 +31,10 @@ public:
     virtual void fprop(const mat_t &x, mat_t& y, mat_t& dy);
     virtual void bprop(const mat_t &x, mat_t& y);
 
+    // const inference path: activation of (W, b) on x, without derivative,
+    // y must not alias x
+    static void forward(const mat_t& W, const mat_t& b, const mat_t& x, mat_t& y);
+
     friend class MultiLayerPerceptron;
 protected:
     // weight matrix of size (#outputsize, #inputsize)
@@ -64,15 +69,28 @@ HiddenLayer::HiddenLayer(const char* name, size_t inputsize, size_t outputsize)
 void HiddenLayer::fprop(const mat_t& x, mat_t& y, mat_t& dy) {
     // feed forward input x to the next layer,
     // output to y (activation) and dy (the derivation of activation function)
+    //
+    // the pre-activation is computed in place in y, which keeps its
+    // storage across calls of the same shape
+
+    gemm(this->W, x, y);
+    y.each_col() += this->b;
+
+    sigmoid(y, y, dy);
+}
+
+void HiddenLayer::forward(const mat_t& W, const mat_t& b, const mat_t& x, mat_t& y) {
+    gemm(W, x, y);
+    y.each_col() += b;
 
-    sigmoid(this->W * x + arma::repmat(this->b, 1, x.n_cols), y, dy);
+    y = 1 / (1 + arma::exp(-y));
 }
 
 void HiddenLayer::bprop(const mat_t& x, mat_t& y) {
     // back propagate input x to the previous layer (for BP),
     // output to y
 
-    y = (this->W.t() * x);
+    gemm(this->W, x, y, true, false);
 }
 
 #endif
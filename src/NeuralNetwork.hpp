@@ -3,9 +3,18 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 #include "config.hpp"
+#include "Checkpoint.hpp"
+#include "Validator.hpp"
+#include "ThreadPool.hpp"
+#include "Autotune.hpp"
 #include <assert.h>
 
 // #################
@@ -40,14 +49,104 @@ public:
     virtual void train(const mat_t& x, const mat_t& y, TrainOpts* trainopts);
     virtual void save(const char* filename);
 
+    // restore weight and bias from a checkpoint file written during training,
+    // and pin the gemm dispatch thresholds recorded in it
+    virtual bool restore(const char* filename);
+    // restore from a checkpoint file and continue training up to maxIter,
+    // with the batch size and staleness of the run that wrote it
+    virtual bool resume(const char* filename, const mat_t& x, const mat_t& y, TrainOpts* trainopts);
+
+    // online update from a small batch or a single sample (one column),
+    // run niter gradient steps and publish the new weights to predict().
+    // Only one thread may update the model, any thread may call predict().
+    virtual double partial_fit(const mat_t& x, const mat_t& y, double lr, size_t niter = 1);
+
+    // run short timed trials of the train step over the candidate batch
+    // sizes, thread counts and BLAS threads, and of the inference over the
+    // chunk sizes and BLAS threads. The best training configuration fills
+    // the fields of trainopts left at 0, the best inference one is applied
+    // to predict(), both are stored in the autotune cache if tuneDir is set.
+    // The weights of the trials are never published to predict()
+    virtual bool autotune(const mat_t& x, const mat_t& y, TrainOpts* trainopts);
+    // fill the fields of trainopts left at 0 from the cached configuration
+    // of this model in trainopts->tuneDir, false if there is none
+    virtual bool load_tuning(TrainOpts* trainopts);
+    // apply the cached inference configuration to predict() and set the
+    // BLAS threads accordingly, for a process that serves the model
+    virtual bool tune_inference(const char* tuneDir);
+
     virtual const mat_t& ff(const mat_t& x);
+    // const inference path on the last published weights, safe to call
+    // from a serving thread while the model is being trained
+    virtual void predict(const mat_t& x, mat_t& out) const;
 
 protected:
     void to_dot(const char* filename);
     void to_json(const char* filename);
 
+    // restore(), the checkpoint is read into s
+    bool restore(const char* filename, Snapshot& s);
+
+    // main training loop, run iteration [start, maxIter)
+    void train_from(size_t start, const mat_t& x, const mat_t& y, TrainOpts* trainopts);
+    // one gradient step (feed forward, back propagation, update), return the loss
+    double step(const mat_t& x, const mat_t& y, double lr);
+    // allocate d, y and dy once, they are reused across train/partial_fit calls
+    void prepare();
+
+    // pipelined gradient step: the gradient and the updated weights of each
+    // layer are computed on the pool as soon as its delta is ready, while
+    // back propagation continues
+    double pipelined_step(const mat_t& x, const mat_t& y, double lr, bool staleness);
+    // swap in the pending update of layer i, if wait is false only when it is done
+    void settle(size_t i, bool wait);
+    // swap in all the pending updates
+    void drain();
+
+    void start_pool(size_t nthreads);
+    void stop_pool();
+
+    // slice x into mini-batches of batchSize columns, none for a full batch.
+    // The mini-batches alias the memory of x, which must outlive them
+    static void split(const mat_t& x, size_t batchSize, std::vector<mat_t>& xs);
+
+    // fill the fields of trainopts left at 0, true if any was changed
+    static bool apply_tuning(const TuneConfig& c, TrainOpts* trainopts);
+    // key of the model in the autotune cache
+    std::string tune_key() const;
+    // bytes held by the training workspaces, and release them
+    size_t workspace_bytes() const;
+    void reset_workspaces();
+
+    // feed x forward through the weights of s in chunks of batch columns
+    // (0: all at once)
+    static void infer(const Snapshot* s, const mat_t& x, mat_t& out, size_t batch);
+
+    // RCU-style weight swap: copy the weights into the spare snapshot and
+    // atomically exchange it with the one read by predict()
+    void publish();
+
+    // wait for the pending validation, log its results and take over the
+    // early stopping state of the validator
+    void report(Validator* val, std::vector<ValidationResult>& results);
+
+    // copy the trainable state into/from a snapshot
+    void snapshot(Snapshot& s, size_t iter) const;
+    // snapshot for a checkpoint, with the early stopping state and the
+    // training options that resume() must keep
+    void checkpoint(Snapshot& s, size_t iter, const TrainOpts* trainopts) const;
+    bool load_snapshot(const Snapshot& s);
+    // load the best weights of the early stopping state, if any
+    void load_best();
+
     size_t nlayers;
 
+    // number of the iterations trained so far
+    size_t iter;
+
+    // early stopping state, saved in the checkpoints
+    EarlyStopState es;
+
     // mean square error (mse)
     double loss;
 
@@ -59,6 +158,39 @@ protected:
     std::vector<mat_t> y;
     // derivative of activation function in each layer.
     std::vector<mat_t> dy;
+
+    // workspaces of the pipelined scheduler, consecutive steps use alternate
+    // ones so that a step never overwrites the inputs of a running update
+    struct Workspace {
+        std::vector<mat_t> d;
+        std::vector<mat_t> y;
+        std::vector<mat_t> dy;
+    } ws[2];
+
+    // issue the update of layer i from the deltas of workspace w to the pool
+    void submit_update(size_t i, const Workspace& w, double lr);
+
+    ThreadPool *pool;
+    // number of pipelined steps so far, selects the workspace
+    size_t nsteps;
+    // pending update of each layer
+    std::vector<std::future<void> > pending;
+
+    // scaled gradient of the weight in each layer
+    std::vector<mat_t> gW;
+
+    // updated weight and bias of each layer, computed by the pool and
+    // swapped in by settle()
+    std::vector<mat_t> Wn;
+    std::vector<mat_t> bn;
+
+    // columns per chunk of predict() (0: all at once), set by autotune()
+    // or tune_inference() while predict() may be serving
+    std::atomic<size_t> inferBatch;
+
+    // weights read by predict(), and the buffer for the next publish()
+    std::shared_ptr<const Snapshot> published;
+    std::shared_ptr<Snapshot> spare;
 };
 
 // ################
@@ -70,6 +202,14 @@ MultiLayerPerceptron::MultiLayerPerceptron(const char *name, size_t inputsize, s
 
     this->inputsize  = inputsize;
     this->outputsize = outputsize;
+
+    this->nlayers    = 0;
+    this->iter       = 0;
+
+    this->pool       = NULL;
+    this->nsteps     = 0;
+
+    this->inferBatch = 0;
 }
 
 void MultiLayerPerceptron::build(const std::vector<size_t>& layersize) {
@@ -93,14 +233,186 @@ void MultiLayerPerceptron::build(const std::vector<size_t>& layersize) {
     this->layers.push_back(new HiddenLayer("layer", _inputsize, _outputsize));
 
     this->nlayers = this->layers.size();
+    this->iter    = 0;
+    this->es      = EarlyStopState();
+
+    this->prepare();
+    this->publish();
 }
 
 void MultiLayerPerceptron::train(const mat_t& x, const mat_t& y, TrainOpts* trainopts) {
     // std::clog << "training MultiLayerPerceptron model ..." << std::endl;
+    this->es = EarlyStopState();
+
+    // autotuned configuration of this model on this host. Not on resume,
+    // the resumed run must keep the batch size of the original one
+    if (trainopts->tuneDir) {
+        this->load_tuning(trainopts);
+    }
+
+    this->train_from(0, x, y, trainopts);
+}
+
+bool MultiLayerPerceptron::restore(const char* filename) {
+    Snapshot s;
+    return this->restore(filename, s);
+}
+
+bool MultiLayerPerceptron::restore(const char* filename, Snapshot& s) {
+    if (!read_checkpoint(filename, s) || !this->load_snapshot(s)) {
+        return false;
+    }
+    this->es = s.es;
+
+    // route each shape of the gemm as the run that wrote the checkpoint,
+    // so that resumed training continues bit-for-bit
+    if (s.hasGemm) {
+        GemmDispatch::instance().set_threshold(s.gemmSquare, s.gemmSkinny);
+    }
+
+    this->publish();
+    return true;
+}
+
+double MultiLayerPerceptron::partial_fit(const mat_t& x, const mat_t& y, double lr, size_t niter) {
+    // no logging and no reallocation on the hot path: the workspaces keep
+    // their size as long as the batch size does not change
+    assert(x.n_cols == y.n_cols);
+
+    double loss = 0;
+    for (size_t j = 0; j < niter; ++j) {
+        loss = this->step(x, y, lr);
+        this->iter++;
+    }
+
+    this->publish();
+    return loss;
+}
+
+void MultiLayerPerceptron::prepare() {
+    if (this->y.size() == this->nlayers + 1) {
+        return;
+    }
+
+    this->d.resize(this->nlayers + 1);
+    this->y.resize(this->nlayers + 1);
+    this->dy.resize(this->nlayers + 1);
+
+    this->gW.resize(this->nlayers);
+}
+
+void MultiLayerPerceptron::publish() {
+    // the spare snapshot is reused once no reader holds it any more,
+    // otherwise a new one is allocated and the old one is freed by its last reader
+    if (!this->spare || this->spare.use_count() > 1) {
+        this->spare = std::make_shared<Snapshot>();
+    } else {
+        // use_count() is a relaxed load, order the last reads of the
+        // readers that released it before the weights are overwritten
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    this->snapshot(*this->spare, this->iter);
+
+    std::shared_ptr<const Snapshot> old = std::atomic_exchange(&this->published, std::shared_ptr<const Snapshot>(this->spare));
+    this->spare = std::const_pointer_cast<Snapshot>(old);
+}
+
+bool MultiLayerPerceptron::resume(const char* filename, const mat_t& x, const mat_t& y, TrainOpts* trainopts) {
+    // the model must be built with the same architecture as the checkpoint
+    Snapshot s;
+    if (!this->restore(filename, s)) {
+        return false;
+    }
+
+    // the options that change the math of a step are taken from the
+    // checkpoint, whatever the cache or the caller would pick now
+    if (s.hasTrainOpts) {
+        if (trainopts->batchSize != s.batchSize || trainopts->staleness != s.staleness) {
+            std::clog << "resuming with the options of the checkpoint: batch " << s.batchSize;
+            std::clog << ", staleness " << s.staleness << std::endl;
+        }
+        trainopts->batchSize = s.batchSize;
+        trainopts->staleness = s.staleness;
+    }
+
+    std::clog << "resuming from " << filename << " at iteration " << this->iter << std::endl;
+    this->train_from(this->iter, x, y, trainopts);
+
+    return true;
+}
+
+void MultiLayerPerceptron::snapshot(Snapshot& s, size_t iter) const {
+    // assignment to a matrix of the same size reuses its memory,
+    // so a snapshot buffer is only allocated once
+    HiddenLayer *layer;
+
+    s.iter = iter;
+    s.W.resize(this->nlayers);
+    s.b.resize(this->nlayers);
+
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        layer  = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        s.W[i] = layer->W;
+        s.b[i] = layer->b;
+    }
+
+    GemmDispatch &dispatch = GemmDispatch::instance();
+    dispatch.init();
+    s.hasGemm    = true;
+    s.gemmSquare = dispatch.square;
+    s.gemmSkinny = dispatch.skinny;
+}
+
+void MultiLayerPerceptron::checkpoint(Snapshot& s, size_t iter, const TrainOpts* trainopts) const {
+    this->snapshot(s, iter);
+
+    s.es           = this->es;
+    s.hasTrainOpts = true;
+    s.batchSize    = trainopts->batchSize;
+    s.staleness    = trainopts->staleness;
+}
+
+bool MultiLayerPerceptron::load_snapshot(const Snapshot& s) {
     HiddenLayer *layer;
 
+    if (s.W.size() != this->nlayers) {
+        std::cerr << "checkpoint has " << s.W.size() << " layers, model has " << this->nlayers << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        if (s.W[i].n_rows != layer->W.n_rows || s.W[i].n_cols != layer->W.n_cols || s.b[i].n_rows != layer->b.n_rows) {
+            std::cerr << "checkpoint does not match the shape of layer " << i << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        layer    = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        layer->W = s.W[i];
+        layer->b = s.b[i];
+    }
+    this->iter = s.iter;
+
+    return true;
+}
+
+void MultiLayerPerceptron::load_best() {
+    if (this->es.W.size() != this->nlayers) {
+        return;
+    }
+
+    HiddenLayer *layer;
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        layer    = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        layer->W = this->es.W[i];
+        layer->b = this->es.b[i];
+    }
+}
+
+void MultiLayerPerceptron::train_from(size_t start, const mat_t& x, const mat_t& y, TrainOpts* trainopts) {
     assert(x.n_cols == y.n_cols);
-    size_t nsamples  = x.n_cols;
 
     // get train options
     // maxIter: maximum number of iterations
@@ -108,48 +420,582 @@ void MultiLayerPerceptron::train(const mat_t& x, const mat_t& y, TrainOpts* trai
     size_t maxIter = trainopts->maxIter;
     double lr      = trainopts->lr;
 
+    // a resumed run that had already stopped early has nothing left to do
+    // but to restore the best weights
+    if (this->es.stopped) {
+        std::clog << "training stopped early at iteration " << this->iter << std::endl;
+        this->load_best();
+        this->publish();
+        return;
+    }
+
+    // checkpoint in a background thread, the writer flushes on destruction
+    CheckpointWriter *ckpt = NULL;
+    if (trainopts->ckptInterval > 0) {
+        ckpt = new CheckpointWriter(trainopts->ckptPrefix, trainopts->ckptKeep);
+    }
+
+    // validate in a background thread, stop early and restore the best weights
+    Validator *val = NULL;
+    if (trainopts->xval && trainopts->yval && trainopts->valInterval > 0) {
+        val = new Validator(trainopts->xval, trainopts->yval, this->es);
+    }
+    bool early = val && trainopts->patience > 0;
+    std::vector<ValidationResult> results;
+    bool stop = false;
+
     // pre-allocate for d, y, and dy
-    this->d.clear();
-    this->d.resize(nlayers + 1);
+    this->prepare();
 
-    this->y.clear();
-    this->y.resize(nlayers + 1);
+    set_blas_threads(trainopts->blasThreads);
 
-    this->dy.clear();
-    this->dy.resize(nlayers + 1);
+    // pipelined scheduler, the updates run on the pool
+    if (trainopts->nthreads > 0) {
+        this->start_pool(trainopts->nthreads);
+    }
+
+    // mini-batches, sliced once
+    std::vector<mat_t> xs, ys;
+    split(x, trainopts->batchSize, xs);
+    split(y, trainopts->batchSize, ys);
+    size_t nbatches = xs.empty() ? 1 : xs.size();
+
+    // the checkpoint of a validation iteration is taken before its weights
+    // are evaluated, a resumed run submits them again
+    if (val && start > 0 && start % trainopts->valInterval == 0) {
+        stop = early && this->es.nbad >= trainopts->patience;
+        if (!stop) {
+            this->snapshot(val->acquire(), this->iter);
+            val->commit();
+        }
+    }
 
     // main loop
-    for (size_t j = 0; j < maxIter; ++j) {
+    for (size_t j = start; j < maxIter && !stop; ++j) {
         std::clog << "Iteration: " << (std::setw(4)) << (j + 1);
 
-        // Stage1: feed forward
-        this->y[0] = x;
-        for (size_t i = 0; i < nlayers; ++i) {
-            layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
-            layer->fprop(this->y[i], this->y[i+1], this->dy[i+1]);
-        }
+        // Stage1-3: feed forward, back propagation, update weight and bias
+        double total = 0;
+        for (size_t k = 0; k < nbatches; ++k) {
+            const mat_t &xb = xs.empty() ? x : xs[k];
+            const mat_t &yb = ys.empty() ? y : ys[k];
 
-        err  = (this->y[nlayers] - y);
-        loss = 0.5 * arma::accu(err % err) / (err.n_elem);
+            if (this->pool) {
+                total += this->pipelined_step(xb, yb, lr, trainopts->staleness) * xb.n_cols;
+            } else {
+                total += this->step(xb, yb, lr) * xb.n_cols;
+            }
+        }
+        loss = total / x.n_cols;
         std::clog << " : loss: " << loss << std::endl;
 
-        this->d[nlayers] = err % this->dy[nlayers];
+        this->iter = j + 1;
 
-        // Stage2: back propagation
-        for (size_t i = this->nlayers - 1; i > 0; --i) {
-            layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
-            layer->bprop(this->d[i+1], this->d[i]);
-            this->d[i] = this->d[i] % this->dy[i];
+        bool ckpt_due = ckpt && (this->iter % trainopts->ckptInterval == 0 || this->iter == maxIter);
+        bool val_due  = val && (this->iter % trainopts->valInterval == 0);
+        if (this->pool && (ckpt_due || val_due)) {
+            this->drain();
         }
 
-        // Stage3: update weight and bias
-        for (size_t i = 0; i < this->nlayers; ++i) {
-            layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
-            layer->W = layer->W - lr * this->d[i+1] * this->y[i].t() / nsamples;
-            layer->b = layer->b - lr * arma::sum(this->d[i+1], 1) / nsamples;
+        // The previous evaluation is waited for first, so that every snapshot
+        // is evaluated and the stop iteration does not depend on thread timing
+        if (val_due) {
+            this->report(val, results);
+            stop = early && this->es.nbad >= trainopts->patience;
+        }
+
+        // Stage4: snapshot for checkpoint, written by the background thread.
+        // The early stopping state includes the evaluations of all the
+        // earlier snapshots, it is taken before the one of this iteration
+        // is committed so that the loop does not wait for it
+        if (ckpt_due) {
+            if (val && !val_due) {
+                this->report(val, results);
+            }
+
+            Snapshot &s = ckpt->acquire();
+            this->checkpoint(s, this->iter, trainopts);
+            ckpt->commit();
+        }
+
+        // Stage5: snapshot for validation, evaluated by the background thread
+        if (val_due && !stop) {
+            this->snapshot(val->acquire(), this->iter);
+            val->commit();
         }
     }
 
+    this->stop_pool();
+
+    if (val) {
+        this->report(val, results);
+        delete val;
+    }
+
+    // a stopped run is marked as such in the checkpoint of its last
+    // iteration, so that resuming from it is a no-op
+    if (stop) {
+        this->es.stopped = true;
+
+        if (ckpt) {
+            Snapshot &s = ckpt->acquire();
+            this->checkpoint(s, this->iter, trainopts);
+            ckpt->commit();
+        }
+    }
+
+    delete ckpt;
+
+    // restore the best weights, the iteration count is kept. They are saved
+    // in <ckptPrefix>.best.ckpt for restore(), next to the checkpoints of
+    // the iterations
+    if (early && !this->es.W.empty()) {
+        std::clog << "restoring best weights of iteration " << this->es.bestIter << std::endl;
+        this->load_best();
+
+        if (trainopts->ckptInterval > 0) {
+            Snapshot s;
+            this->checkpoint(s, this->es.bestIter, trainopts);
+            write_checkpoint((std::string(trainopts->ckptPrefix) + ".best.ckpt").c_str(), s);
+        }
+    }
+
+    this->publish();
+}
+
+double MultiLayerPerceptron::pipelined_step(const mat_t& x, const mat_t& y, double lr, bool staleness) {
+    HiddenLayer *layer;
+
+    Workspace &w = this->ws[this->nsteps++ % 2];
+
+    // Stage1: feed forward, each layer only waits for its own pending update
+    w.y[0] = x;
+    for (size_t i = 0; i < nlayers; ++i) {
+        this->settle(i, !staleness);
+
+        layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        layer->fprop(w.y[i], w.y[i+1], w.dy[i+1]);
+    }
+
+    err  = (w.y[nlayers] - y);
+    loss = 0.5 * arma::accu(err % err) / (err.n_elem);
+
+    w.d[nlayers] = err % w.dy[nlayers];
+
+    // Stage2/3: back propagation, the update of layer i is issued to the
+    // pool as soon as d[i+1] is ready, and runs while d[i] and the lower
+    // layers are computed. The pool only reads W and writes the updated
+    // weights to Wn/bn, so that bprop and a stale forward of the next step
+    // may still read W meanwhile, settle() only swaps the buffers.
+    for (size_t i = this->nlayers; i-- > 0;) {
+        layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+
+        // without staleness the forward has settled layer i already, the
+        // update runs alongside its bprop
+        if (!staleness) {
+            this->submit_update(i, w, lr);
+        }
+
+        if (i > 0) {
+            layer->bprop(w.d[i+1], w.d[i]);
+            w.d[i] = w.d[i] % w.dy[i];
+        }
+
+        // with staleness bprop must use the weights of the forward, the
+        // last update is swapped in only after it. The update buffers of
+        // layer i are reused, this bounds the staleness to one step
+        if (staleness) {
+            this->settle(i, true);
+            this->submit_update(i, w, lr);
+        }
+    }
+
+    return loss;
+}
+
+void MultiLayerPerceptron::submit_update(size_t i, const Workspace& w, double lr) {
+    HiddenLayer *layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+    size_t nsamples = w.y[0].n_cols;
+
+    const mat_t *di = &w.d[i+1];
+    const mat_t *yi = &w.y[i];
+    const mat_t *W  = &layer->W;
+    const mat_t *b  = &layer->b;
+    mat_t *gW = &this->gW[i];
+    mat_t *Wn = &this->Wn[i];
+    mat_t *bn = &this->bn[i];
+    this->pending[i] = this->pool->submit([=]() {
+        gemm(*di, *yi, *gW, false, true);
+        *gW *= lr / nsamples;
+
+        *Wn = *W - *gW;
+        *bn = *b - lr * arma::sum(*di, 1) / nsamples;
+    });
+}
+
+void MultiLayerPerceptron::settle(size_t i, bool wait) {
+    if (!this->pending[i].valid()) {
+        return;
+    }
+    if (!wait && this->pending[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    this->pending[i].get();
+
+    HiddenLayer *layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+    layer->W.swap(this->Wn[i]);
+    layer->b.swap(this->bn[i]);
+}
+
+void MultiLayerPerceptron::drain() {
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        this->settle(i, true);
+    }
+}
+
+void MultiLayerPerceptron::start_pool(size_t nthreads) {
+    this->pool = new ThreadPool(nthreads);
+    this->pending.resize(this->nlayers);
+    this->Wn.resize(this->nlayers);
+    this->bn.resize(this->nlayers);
+
+    for (size_t k = 0; k < 2; ++k) {
+        this->ws[k].d.resize(this->nlayers + 1);
+        this->ws[k].y.resize(this->nlayers + 1);
+        this->ws[k].dy.resize(this->nlayers + 1);
+    }
+}
+
+void MultiLayerPerceptron::stop_pool() {
+    if (!this->pool) {
+        return;
+    }
+
+    this->drain();
+    delete this->pool;
+    this->pool = NULL;
+}
+
+void MultiLayerPerceptron::split(const mat_t& x, size_t batchSize, std::vector<mat_t>& xs) {
+    xs.clear();
+    if (batchSize == 0 || batchSize >= x.n_cols) {
+        return;
+    }
+
+    // reserved up front, the aliases are never moved. The columns of a
+    // mini-batch are contiguous, they are only read through const references
+    xs.reserve((x.n_cols + batchSize - 1) / batchSize);
+    for (size_t first = 0; first < x.n_cols; first += batchSize) {
+        size_t ncols = std::min(batchSize, (size_t)x.n_cols - first);
+        xs.emplace_back(const_cast<double*>(x.colptr(first)), x.n_rows, ncols, false, true);
+    }
+}
+
+bool MultiLayerPerceptron::autotune(const mat_t& x, const mat_t& y, TrainOpts* trainopts) {
+    // each trial runs the train step, or the inference, for trialTime seconds
+    const double trialTime = 0.05;
+
+    assert(x.n_cols == y.n_cols);
+
+    // calibrate the gemm dispatch before timing anything
+    GemmDispatch::instance().init();
+
+    // the trials train the model, its state is restored afterwards
+    Snapshot saved;
+    this->snapshot(saved, this->iter);
+    this->prepare();
+
+    std::vector<size_t> batches = TuneCache::batch_sizes(x.n_cols);
+    std::vector<size_t> threads = TuneCache::thread_counts();
+
+    TuneConfig best;
+    best.trainRate = 0;
+    best.inferRate = 0;
+
+    // train step
+    for (size_t bi = 0; bi < batches.size(); ++bi) {
+        std::vector<mat_t> xs, ys;
+        split(x, batches[bi], xs);
+        split(y, batches[bi], ys);
+        size_t nbatches = xs.empty() ? 1 : xs.size();
+
+        for (size_t ti = 0; ti < threads.size(); ++ti) {
+            // no more update tasks than layers in flight
+            if (threads[ti] > this->nlayers) {
+                continue;
+            }
+
+            for (size_t bt = 1; bt < threads.size(); ++bt) {
+                TuneConfig c;
+                c.batchSize   = batches[bi];
+                c.nthreads    = threads[ti];
+                c.blasThreads = threads[bt];
+
+                this->reset_workspaces();
+                set_blas_threads(c.blasThreads);
+                if (c.nthreads > 0) {
+                    this->start_pool(c.nthreads);
+                }
+
+                // untimed warm-up, which also sizes the workspaces (both of
+                // them when pipelined) before they are measured
+                size_t nwarm = this->pool ? 2 : 1;
+                for (size_t k = 0; k < nwarm; ++k) {
+                    const mat_t &xb = xs.empty() ? x : xs[k % nbatches];
+                    const mat_t &yb = ys.empty() ? y : ys[k % nbatches];
+                    if (this->pool) {
+                        this->pipelined_step(xb, yb, trainopts->lr, trainopts->staleness);
+                    } else {
+                        this->step(xb, yb, trainopts->lr);
+                    }
+                }
+                if (this->pool) {
+                    this->drain();
+                }
+                c.workspaceBytes = this->workspace_bytes();
+
+                if (trainopts->tuneMaxBytes > 0 && c.workspaceBytes > trainopts->tuneMaxBytes) {
+                    this->stop_pool();
+                    std::clog << "Autotune: batch " << (std::setw(5)) << c.batchSize << ", threads " << c.nthreads;
+                    std::clog << ", blas threads " << c.blasThreads << " : skipped, " << c.workspaceBytes << " bytes" << std::endl;
+                    continue;
+                }
+
+                size_t nsamples = 0, k = 0;
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                std::chrono::duration<double> dt;
+                do {
+                    const mat_t &xb = xs.empty() ? x : xs[k % nbatches];
+                    const mat_t &yb = ys.empty() ? y : ys[k % nbatches];
+                    if (this->pool) {
+                        this->pipelined_step(xb, yb, trainopts->lr, trainopts->staleness);
+                    } else {
+                        this->step(xb, yb, trainopts->lr);
+                    }
+                    nsamples += xb.n_cols;
+                    k++;
+
+                    dt = std::chrono::steady_clock::now() - t0;
+                } while (dt.count() < trialTime);
+                this->stop_pool();
+                dt = std::chrono::steady_clock::now() - t0;
+
+                c.trainRate = nsamples / dt.count();
+
+                std::clog << "Autotune: batch " << (std::setw(5)) << c.batchSize << ", threads " << c.nthreads;
+                std::clog << ", blas threads " << c.blasThreads << " : " << c.trainRate << " samples/sec (train), ";
+                std::clog << c.workspaceBytes << " bytes" << std::endl;
+
+                if (c.trainRate > best.trainRate) {
+                    best.batchSize      = c.batchSize;
+                    best.nthreads       = c.nthreads;
+                    best.blasThreads    = c.blasThreads;
+                    best.trainRate      = c.trainRate;
+                    best.workspaceBytes = c.workspaceBytes;
+                }
+            }
+        }
+    }
+
+    // the weights left by the trials are never published, predict() only
+    // ever serves the weights of the model
+    this->load_snapshot(saved);
+    this->reset_workspaces();
+
+    // inference, the whole of x in chunks of each batch size, on the
+    // restored weights and without touching the ones served by predict()
+    for (size_t bi = 0; bi < batches.size(); ++bi) {
+        for (size_t bt = 1; bt < threads.size(); ++bt) {
+            set_blas_threads(threads[bt]);
+
+            // untimed warm-up
+            mat_t out;
+            infer(&saved, x, out, batches[bi]);
+
+            size_t nsamples = 0;
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            std::chrono::duration<double> dt;
+            do {
+                infer(&saved, x, out, batches[bi]);
+                nsamples += x.n_cols;
+
+                dt = std::chrono::steady_clock::now() - t0;
+            } while (dt.count() < trialTime);
+
+            double rate = nsamples / dt.count();
+
+            std::clog << "Autotune: chunk " << (std::setw(5)) << batches[bi] << ", blas threads " << threads[bt];
+            std::clog << " : " << rate << " samples/sec (inference)" << std::endl;
+
+            if (rate > best.inferRate) {
+                best.inferBatch       = batches[bi];
+                best.inferBlasThreads = threads[bt];
+                best.inferRate        = rate;
+            }
+        }
+    }
+
+    if (best.trainRate == 0 || best.inferRate == 0) {
+        return false;
+    }
+
+    this->inferBatch = best.inferBatch;
+
+    if (trainopts->tuneDir) {
+        TuneCache(trainopts->tuneDir).store(this->tune_key(), best);
+    }
+
+    apply_tuning(best, trainopts);
+    set_blas_threads(trainopts->blasThreads);
+
+    return true;
+}
+
+bool MultiLayerPerceptron::load_tuning(TrainOpts* trainopts) {
+    TuneConfig c;
+    if (!trainopts->tuneDir || !TuneCache(trainopts->tuneDir).lookup(this->tune_key(), c)) {
+        return false;
+    }
+
+    if (apply_tuning(c, trainopts)) {
+        std::clog << "using autotuned configuration: batch " << trainopts->batchSize << ", threads " << trainopts->nthreads;
+        std::clog << ", blas threads " << trainopts->blasThreads << std::endl;
+    }
+
+    return true;
+}
+
+bool MultiLayerPerceptron::tune_inference(const char* tuneDir) {
+    TuneConfig c;
+    if (!TuneCache(tuneDir).lookup(this->tune_key(), c)) {
+        return false;
+    }
+
+    std::clog << "using autotuned inference: chunk " << c.inferBatch << ", blas threads " << c.inferBlasThreads << std::endl;
+
+    this->inferBatch = c.inferBatch;
+    set_blas_threads(c.inferBlasThreads);
+
+    return true;
+}
+
+bool MultiLayerPerceptron::apply_tuning(const TuneConfig& c, TrainOpts* trainopts) {
+    // 0 is the default of each field, a value set by the caller is kept
+    bool changed = false;
+    if (trainopts->batchSize == 0 && c.batchSize != 0) {
+        trainopts->batchSize = c.batchSize;
+        changed = true;
+    }
+    if (trainopts->nthreads == 0 && c.nthreads != 0) {
+        trainopts->nthreads = c.nthreads;
+        changed = true;
+    }
+    if (trainopts->blasThreads == 0 && c.blasThreads != 0) {
+        trainopts->blasThreads = c.blasThreads;
+        changed = true;
+    }
+
+    return changed;
+}
+
+std::string MultiLayerPerceptron::tune_key() const {
+    // layer sizes, e.g. 4x5x3
+    std::ostringstream oss;
+    oss << this->inputsize;
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        oss << "x" << dynamic_cast<HiddenLayer *>(this->layers[i])->W.n_rows;
+    }
+
+    return oss.str();
+}
+
+size_t MultiLayerPerceptron::workspace_bytes() const {
+    size_t n = this->err.n_elem;
+
+    for (size_t i = 0; i < this->d.size(); ++i) {
+        n += this->d[i].n_elem + this->y[i].n_elem + this->dy[i].n_elem;
+    }
+    for (size_t k = 0; k < 2; ++k) {
+        for (size_t i = 0; i < this->ws[k].d.size(); ++i) {
+            n += this->ws[k].d[i].n_elem + this->ws[k].y[i].n_elem + this->ws[k].dy[i].n_elem;
+        }
+    }
+    for (size_t i = 0; i < this->gW.size(); ++i) {
+        n += this->gW[i].n_elem;
+    }
+    for (size_t i = 0; i < this->Wn.size(); ++i) {
+        n += this->Wn[i].n_elem + this->bn[i].n_elem;
+    }
+
+    return n * sizeof(double);
+}
+
+void MultiLayerPerceptron::reset_workspaces() {
+    this->err.reset();
+
+    this->d.clear();
+    this->y.clear();
+    this->dy.clear();
+    this->gW.clear();
+    this->Wn.clear();
+    this->bn.clear();
+    for (size_t k = 0; k < 2; ++k) {
+        this->ws[k].d.clear();
+        this->ws[k].y.clear();
+        this->ws[k].dy.clear();
+    }
+
+    this->prepare();
+}
+
+double MultiLayerPerceptron::step(const mat_t& x, const mat_t& y, double lr) {
+    HiddenLayer *layer;
+    size_t nsamples = x.n_cols;
+
+    // Stage1: feed forward
+    this->y[0] = x;
+    for (size_t i = 0; i < nlayers; ++i) {
+        layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        layer->fprop(this->y[i], this->y[i+1], this->dy[i+1]);
+    }
+
+    err  = (this->y[nlayers] - y);
+    loss = 0.5 * arma::accu(err % err) / (err.n_elem);
+
+    this->d[nlayers] = err % this->dy[nlayers];
+
+    // Stage2: back propagation
+    for (size_t i = this->nlayers - 1; i > 0; --i) {
+        layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        layer->bprop(this->d[i+1], this->d[i]);
+        this->d[i] = this->d[i] % this->dy[i];
+    }
+
+    // Stage3: update weight and bias
+    for (size_t i = 0; i < this->nlayers; ++i) {
+        layer = dynamic_cast<HiddenLayer *>(this->layers[i]);
+        gemm(this->d[i+1], this->y[i], this->gW[i], false, true);
+        this->gW[i] *= lr / nsamples;
+
+        layer->W -= this->gW[i];
+        layer->b -= lr * arma::sum(this->d[i+1], 1) / nsamples;
+    }
+
+    return loss;
+}
+
+void MultiLayerPerceptron::report(Validator* val, std::vector<ValidationResult>& results) {
+    // log the validation results arrived since the last report
+    size_t first = results.size();
+
+    val->flush();
+    val->poll(results);
+    this->es = val->state();
+
+    for (size_t i = first; i < results.size(); ++i) {
+        std::clog << "Validation: " << (std::setw(4)) << results[i].iter;
+        std::clog << " : loss: " << results[i].loss << ", accuracy: " << results[i].accuracy << std::endl;
+    }
 }
 
 void MultiLayerPerceptron::save(const char* filename) {
@@ -179,6 +1025,44 @@ const mat_t& MultiLayerPerceptron::ff(const mat_t& x) {
     return this->y[nlayers];
 }
 
+void MultiLayerPerceptron::predict(const mat_t& x, mat_t& out) const {
+    // unlike ff(), no member is modified. The snapshot is kept alive by the
+    // local reference even if the trainer publishes a new one meanwhile.
+    std::shared_ptr<const Snapshot> s = std::atomic_load(&this->published);
+    infer(s.get(), x, out, this->inferBatch.load(std::memory_order_relaxed));
+}
+
+void MultiLayerPerceptron::infer(const Snapshot* s, const mat_t& x, mat_t& out, size_t batch) {
+    // the activations ping-pong between two local buffers
+    mat_t a[2];
+
+    // chunks of batch columns keep the activations in cache on a large x
+    if (batch == 0 || batch >= x.n_cols) {
+        batch = x.n_cols;
+    }
+
+    for (size_t first = 0; first < x.n_cols || first == 0; first += batch) {
+        size_t ncols = std::min(batch, (size_t)x.n_cols - first);
+        // read-only alias of the columns of the chunk
+        const mat_t xb(const_cast<double*>(x.colptr(first)), x.n_rows, ncols, false, true);
+
+        const mat_t *in = &xb;
+        for (size_t i = 0; s && i < s->W.size(); ++i) {
+            HiddenLayer::forward(s->W[i], s->b[i], *in, a[i % 2]);
+            in = &a[i % 2];
+        }
+
+        if (ncols == x.n_cols) {
+            out = *in;
+            break;
+        }
+        if (first == 0) {
+            out.set_size(in->n_rows, x.n_cols);
+        }
+        out.cols(first, first + ncols - 1) = *in;
+    }
+}
+
 void MultiLayerPerceptron::to_dot(const char* filename = "nn_mlp.dot") {
     FILE *fp = fopen(filename, "w");
     if (NULL == fp) {
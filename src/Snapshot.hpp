@@ -0,0 +1,173 @@
+#ifndef __Snapshot_H__
+#define __Snapshot_H__
+
+#include <vector>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "config.hpp"
+
+// #################
+//    Interface
+// #################
+
+// state of early stopping (see Validator): the number of validations
+// without improvement, the lowest validation loss and the weights that
+// reached it, and whether training has stopped
+struct EarlyStopState {
+    bool stopped    = false;
+    size_t nbad     = 0;
+    double bestLoss = std::numeric_limits<double>::infinity();
+    size_t bestIter = 0;
+
+    std::vector<mat_t> W;
+    std::vector<mat_t> b;
+};
+
+// copy of the trainable state of a model at a given iteration
+struct Snapshot {
+    size_t iter;
+
+    std::vector<mat_t> W;
+    std::vector<mat_t> b;
+
+    // only filled for checkpoints, so that resumed training stops early
+    // at the same iteration
+    EarlyStopState es;
+
+    // thresholds of the gemm dispatch (see GemmDispatch), so that resumed
+    // training routes each shape as the original run did. Unknown in the
+    // checkpoints of older versions
+    bool hasGemm      = false;
+    size_t gemmSquare = 0;
+    size_t gemmSkinny = 0;
+
+    // training options that change the math of a step (see TrainOpts),
+    // only filled for checkpoints, and applied by resume()
+    bool hasTrainOpts = false;
+    size_t batchSize  = 0;
+    bool staleness    = false;
+};
+
+// Hand snapshots of the model over to a background thread.
+//
+// Two snapshot buffers are used: the front one is owned by the worker
+// thread while it is being processed, the back one is filled by the
+// training loop. The training loop never waits for the worker, if the
+// worker is still busy when a new snapshot is committed, the staged
+// snapshot is simply replaced by the newer one.
+class SnapshotWorker {
+public:
+    SnapshotWorker();
+    virtual ~SnapshotWorker() {};
+
+    // get the back buffer to be filled by the caller
+    Snapshot& acquire();
+    // hand the filled back buffer over to the worker thread
+    void commit();
+    // wait until all the committed snapshots have been processed
+    void flush();
+
+protected:
+    // process a snapshot in the worker thread
+    virtual void process(const Snapshot& snapshot) = 0;
+
+    // start/stop the worker thread, must be called by the derived class
+    // since process() is not available before/after its lifetime
+    void start();
+    void stop();
+
+private:
+    void run();
+
+    Snapshot buffers[2];
+    size_t front;
+
+    bool filling;
+    bool staged;
+    bool busy;
+    bool stopping;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread worker;
+};
+
+// ################
+//  Implementation
+// ################
+
+SnapshotWorker::SnapshotWorker() {
+    this->front    = 0;
+
+    this->filling  = false;
+    this->staged   = false;
+    this->busy     = false;
+    this->stopping = false;
+}
+
+Snapshot& SnapshotWorker::acquire() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->filling = true;
+    return this->buffers[1 - this->front];
+}
+
+void SnapshotWorker::commit() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->filling = false;
+        this->staged  = true;
+    }
+    this->cv.notify_all();
+}
+
+void SnapshotWorker::flush() {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->cv.wait(lock, [this] { return !this->staged && !this->busy; });
+}
+
+void SnapshotWorker::start() {
+    this->worker = std::thread(&SnapshotWorker::run, this);
+}
+
+void SnapshotWorker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->filling  = false;
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+}
+
+void SnapshotWorker::run() {
+    std::unique_lock<std::mutex> lock(this->mtx);
+
+    for (;;) {
+        // the back buffer is only taken over once the producer is done with it
+        this->cv.wait(lock, [this] {
+            return (this->staged && !this->filling) || (this->stopping && !this->staged);
+        });
+        if (!this->staged) {
+            break;
+        }
+
+        this->front  = 1 - this->front;
+        this->staged = false;
+        this->busy   = true;
+
+        lock.unlock();
+        this->process(this->buffers[this->front]);
+        lock.lock();
+
+        this->busy = false;
+        this->cv.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __ThreadPool_H__
+#define __ThreadPool_H__
+
+#include <vector>
+#include <queue>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// #################
+//    Interface
+// #################
+
+// Fixed size pool of worker threads running tasks in FIFO order.
+class ThreadPool {
+public:
+    ThreadPool(size_t nthreads = 1);
+    ~ThreadPool();
+
+    // queue a task, the future becomes ready once the task has run
+    std::future<void> submit(const std::function<void()>& task);
+
+    size_t size() const {
+        return this->workers.size();
+    };
+
+private:
+    void run();
+
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()> > tasks;
+
+    bool stopping;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+// ################
+//  Implementation
+// ################
+
+ThreadPool::ThreadPool(size_t nthreads) {
+    this->stopping = false;
+
+    if (nthreads == 0) {
+        nthreads = 1;
+    }
+    for (size_t i = 0; i < nthreads; ++i) {
+        this->workers.push_back(std::thread(&ThreadPool::run, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    // queued tasks are run before the workers exit
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+
+    for (size_t i = 0; i < this->workers.size(); ++i) {
+        this->workers[i].join();
+    }
+}
+
+std::future<void> ThreadPool::submit(const std::function<void()>& task) {
+    std::packaged_task<void()> t(task);
+    std::future<void> f = t.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->tasks.push(std::move(t));
+    }
+    this->cv.notify_one();
+
+    return f;
+}
+
+void ThreadPool::run() {
+    for (;;) {
+        std::packaged_task<void()> t;
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cv.wait(lock, [this] { return this->stopping || !this->tasks.empty(); });
+            if (this->tasks.empty()) {
+                break;
+            }
+
+            t = std::move(this->tasks.front());
+            this->tasks.pop();
+        }
+        t();
+    }
+}
+
+#endif
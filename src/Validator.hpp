@@ -0,0 +1,106 @@
+#ifndef __Validator_H__
+#define __Validator_H__
+
+#include <vector>
+#include <assert.h>
+
+#include "Layer.hpp"
+#include "Snapshot.hpp"
+#include "config.hpp"
+
+// #################
+//    Interface
+// #################
+
+typedef struct {
+    size_t iter;
+    double loss;
+    double accuracy;
+} ValidationResult;
+
+// Evaluate snapshots of the model on a validation set in a background
+// thread, and track the early stopping state.
+//
+// A committed snapshot replaces one that is still staged, so the caller
+// must flush() before each commit() for every snapshot to be evaluated.
+// The results and the state are only read after flush(), which orders
+// them after the evaluations.
+class Validator: public SnapshotWorker {
+public:
+    Validator(const mat_t* x, const mat_t* y, const EarlyStopState& state);
+    ~Validator();
+
+    // move the results evaluated since the last poll into results
+    void poll(std::vector<ValidationResult>& results);
+
+    // the early stopping state after the evaluations so far
+    const EarlyStopState& state() const {
+        return this->es;
+    };
+
+protected:
+    void process(const Snapshot& snapshot);
+
+    const mat_t* x;
+    const mat_t* y;
+
+    // activations, used alternately by consecutive layers
+    mat_t a[2];
+
+    EarlyStopState es;
+    std::vector<ValidationResult> results;
+};
+
+// ################
+//  Implementation
+// ################
+
+Validator::Validator(const mat_t* x, const mat_t* y, const EarlyStopState& state) {
+    assert(x->n_cols == y->n_cols);
+
+    this->x  = x;
+    this->y  = y;
+    this->es = state;
+
+    this->start();
+}
+
+Validator::~Validator() {
+    this->stop();
+}
+
+void Validator::poll(std::vector<ValidationResult>& results) {
+    results.insert(results.end(), this->results.begin(), this->results.end());
+    this->results.clear();
+}
+
+void Validator::process(const Snapshot& snapshot) {
+    // feed forward through the const inference path of the snapshot
+    const mat_t *in = this->x;
+    for (size_t i = 0; i < snapshot.W.size(); ++i) {
+        HiddenLayer::forward(snapshot.W[i], snapshot.b[i], *in, this->a[i % 2]);
+        in = &this->a[i % 2];
+    }
+
+    mat_t err = (*in - *this->y);
+
+    ValidationResult result;
+    result.iter     = snapshot.iter;
+    result.loss     = 0.5 * arma::accu(err % err) / (err.n_elem);
+    // argmax of each column as a linear reduction
+    result.accuracy = (double)arma::accu(arma::index_max(*in, 0) == arma::index_max(*this->y, 0)) / in->n_cols;
+
+    if (result.loss < this->es.bestLoss) {
+        this->es.bestLoss = result.loss;
+        this->es.bestIter = snapshot.iter;
+        this->es.W        = snapshot.W;
+        this->es.b        = snapshot.b;
+        this->es.nbad     = 0;
+    } else {
+        this->es.nbad++;
+    }
+
+    this->results.push_back(result);
+}
+
+#endif
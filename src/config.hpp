@@ -15,12 +15,6 @@ typedef std::pair<T, T> S;
 
 #endif
 
-typedef struct {
-    size_t maxIter;
-    double lr;
-} TrainOpts;
-
-
 // Configure MatrixOp backend
 #define USE_ARMA
 
@@ -41,4 +35,45 @@ typedef arma::mat mat_t;
 
 #endif
 
+typedef struct {
+    size_t maxIter;
+    double lr;
+
+    // checkpoint every ckptInterval iterations (0: disabled)
+    size_t ckptInterval = 0;
+    // number of the most recent checkpoints kept on disk
+    size_t ckptKeep = 3;
+    // checkpoint files are named <ckptPrefix>.<iteration>.ckpt
+    const char* ckptPrefix = "nn_mlp";
+
+    // validation set for early stopping (NULL: disabled)
+    const mat_t* xval = NULL;
+    const mat_t* yval = NULL;
+    // validate every valInterval iterations
+    size_t valInterval = 10;
+    // stop after patience validations without improvement, and restore the
+    // best weights (0: validate only, never stop early)
+    size_t patience = 0;
+
+    // pipelined training on a pool of nthreads workers (0: sequential)
+    size_t nthreads = 0;
+    // pipelined training only: when set, the next step feeds forward through
+    // a layer whose update is still running with its previous weights, at
+    // most one step stale
+    bool staleness = false;
+
+    // number of samples per gradient step (0: full batch)
+    size_t batchSize = 0;
+    // number of BLAS threads (0: library default)
+    size_t blasThreads = 0;
+    // directory of the per-host autotune cache (NULL: disabled). train()
+    // fills batchSize, nthreads and blasThreads from the cached configuration
+    // of the model where they are left at 0. resume() does not use the
+    // cache, it takes batchSize and staleness from the checkpoint
+    const char* tuneDir = NULL;
+    // autotune skips configurations whose workspaces exceed tuneMaxBytes
+    // (0: no limit)
+    size_t tuneMaxBytes = 0;
+} TrainOpts;
+
 #endif